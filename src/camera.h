@@ -1,5 +1,6 @@
 #pragma once
 #include "defines.h"
+#include "ray_packet.h"
 
 class camera {
 public:
@@ -20,6 +21,13 @@ public:
 		lower_left_corner = origin - horizontal / 2 - vertical / 2 - focus_dist * w;
 
 		lens_radius = aperture / 2;
+		unit_viewport_height = viewport_height;
+	}
+
+	// primary rays get a cone that covers one pixel
+	void set_image_height(int image_height)
+	{
+		pixel_spread = unit_viewport_height / image_height;
 	}
 
 	ray get_ray(double s, double t) const {
@@ -27,7 +35,16 @@ public:
 		vec3 rd = lens_radius * random_in_unit_disk();
 		vec3 offset = u * rd.x() + v * rd.y();
 
-		return ray(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset);
+		return ray(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, 0.0, pixel_spread);
+	}
+
+	// generate a packet of primary rays, lanes that are not active are left untouched
+	void get_ray_packet(const double s[PACKET_SIZE], const double t[PACKET_SIZE], ray_packet& packet) const {
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			if (packet.active[lane])
+				packet.set(lane, get_ray(s[lane], t[lane]));
+		}
 	}
 
 private:
@@ -38,4 +55,6 @@ private:
 	vec3 vertical;
 	vec3 u, v, w;
 	double lens_radius;
+	double unit_viewport_height;
+	double pixel_spread = 0.0;
 };
\ No newline at end of file
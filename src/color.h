@@ -54,4 +54,12 @@ void write_color(std::ofstream& out, vec3 pixel_color, int samples_per_pixel)
 	out << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
 		<< static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
 		<< static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
-}
\ No newline at end of file
+}
+
+// pfm stores the averaged linear color as binary floats
+void write_color_pfm(std::ofstream& out, vec3 pixel_color, int samples_per_pixel)
+{
+	auto scale = 1.0 / samples_per_pixel;
+	float rgb[3] = { float(scale * pixel_color.x()), float(scale * pixel_color.y()), float(scale * pixel_color.z()) };
+	out.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+}
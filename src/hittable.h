@@ -1,5 +1,6 @@
 #pragma once
 #include "ray.h"
+#include "ray_packet.h"
 #include "defines.h"
 
 class material;
@@ -8,9 +9,12 @@ struct hit_record {
 public:
     vec3 p;
     vec3 normal;
-	std::shared_ptr<material> mat;
+	const material* mat; // owned by the hittable, a raw pointer keeps hit_record copies cheap
     double t;
     bool front_face;
+	double u, v; // surface coordinates for texture lookup
+	double cone_width; // width of the ray cone at p
+	double uv_footprint; // cone_width in uv units, selects the texture mip level
 
 	// check if normal and ray's direction is the same, prevent the back of a geometry
     inline void set_face_normal(const ray& r, const vec3& outward_normal)
@@ -23,4 +27,24 @@ public:
 class hittable {
 public:
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+
+	// deep copy, used to keep a replica of the scene in the memory of every numa node
+	virtual std::shared_ptr<hittable> clone() const = 0;
+
+	// intersect every active lane of the packet, closest_t is the per-lane t_max and gets shrunk on hit
+	virtual void hit_packet(const ray_packet& rp, double t_min, double closest_t[PACKET_SIZE],
+		hit_record recs[PACKET_SIZE], bool is_hit[PACKET_SIZE]) const
+	{
+		// fallback: trace the lanes one by one
+		hit_record temp_rec;
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			if (rp.active[lane] && hit(rp.get(lane), t_min, closest_t[lane], temp_rec))
+			{
+				is_hit[lane] = true;
+				closest_t[lane] = temp_rec.t;
+				recs[lane] = temp_rec;
+			}
+		}
+	}
 };
\ No newline at end of file
@@ -14,6 +14,11 @@ public:
 
 	// check our objects and get the closest object the ray hit
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual std::shared_ptr<hittable> clone() const override;
+
+	// the whole packet is tested against one object before moving to the next
+	virtual void hit_packet(const ray_packet& rp, double t_min, double closest_t[PACKET_SIZE],
+		hit_record recs[PACKET_SIZE], bool is_hit[PACKET_SIZE]) const override;
 
 public:
 	std::vector<std::shared_ptr<hittable>> objects;
@@ -37,3 +42,19 @@ bool hittble_list::hit(const ray& r, double t_min, double t_max, hit_record& rec
 
 	return is_hit;
 }
+
+std::shared_ptr<hittable> hittble_list::clone() const
+{
+	auto list = std::make_shared<hittble_list>();
+	list->objects.reserve(objects.size());
+	for (const auto& object : objects)
+		list->add(object->clone());
+	return list;
+}
+
+void hittble_list::hit_packet(const ray_packet& rp, double t_min, double closest_t[PACKET_SIZE],
+	hit_record recs[PACKET_SIZE], bool is_hit[PACKET_SIZE]) const
+{
+	for (const auto& object : objects)
+		object->hit_packet(rp, t_min, closest_t, recs, is_hit);
+}
@@ -5,19 +5,31 @@
 #include "sphere.h"
 #include "camera.h"
 #include "material.h"
+#include "render_config.h"
+#include "texture.h"
+#include "preview.h"
 
 #include <tbb/tbb.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_reduce.h>
 #include <tbb/parallel_pipeline.h>
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include <tbb/info.h>
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <unordered_map>
+#include <thread>
 
-hittble_list random_scene()
+// sphere_texture: if set, the big diffuse sphere uses it and the ground becomes a checker board
+hittble_list random_scene(std::shared_ptr<texture> sphere_texture = nullptr)
 {
 	hittble_list world;
-	auto mat_ground = std::make_shared<lambertian>(vec3(0.5, 0.5, 0.5));
+	auto mat_ground = sphere_texture
+		? std::make_shared<material>(lambertian(std::make_shared<checker_texture>(vec3(0.2, 0.3, 0.1), vec3(0.9, 0.9, 0.9), 10)))
+		: std::make_shared<material>(lambertian(vec3(0.5, 0.5, 0.5)));
 	world.add(std::make_shared<sphere>(vec3(0, -1000, 0), 1000, mat_ground));
 	
 	for (int a = -11; a < 11; ++a)
@@ -35,7 +47,7 @@ hittble_list random_scene()
 				{
 					// diffuse
 					auto albedo = vec3::random() * vec3::random();
-					mat_sphere = std::make_shared<lambertian>(albedo);
+					mat_sphere = std::make_shared<material>(lambertian(albedo));
 					world.add(std::make_shared<sphere>(center, 0.2, mat_sphere));
 				}
 				else if (choose_mat < 0.95)
@@ -43,31 +55,41 @@ hittble_list random_scene()
 					// metal
 					auto albedo = vec3::random(0.5, 1);
 					auto fuzz = random_double(0, 0.5);
-					mat_sphere = std::make_shared<metal>(albedo, fuzz);
+					mat_sphere = std::make_shared<material>(metal(albedo, fuzz));
 					world.add(std::make_shared<sphere>(center, 0.2, mat_sphere));
 				}
 				else
 				{
 					// glass
-					mat_sphere = std::make_shared<dielectric>(1.5);
+					mat_sphere = std::make_shared<material>(dielectric(1.5));
 					world.add(std::make_shared<sphere>(center, 0.2, mat_sphere));
 				}
 			}
 		}
 	}
 
-	auto mat_1 = std::make_shared<dielectric>(1.5);
+	auto mat_1 = std::make_shared<material>(dielectric(1.5));
 	world.add(std::make_shared<sphere>(vec3(0, 1, 0), 1.0, mat_1));
 
-	auto mat_2 = std::make_shared<lambertian>(vec3(0.4, 0.2, 0.1));
+	auto mat_2 = sphere_texture
+		? std::make_shared<material>(lambertian(sphere_texture))
+		: std::make_shared<material>(lambertian(vec3(0.4, 0.2, 0.1)));
 	world.add(std::make_shared<sphere>(vec3(-4, 1, 0), 1.0, mat_2));
 
-	auto mat_3 = std::make_shared<metal>(vec3(0.7, 0.6, 0.5), 0.0);
+	auto mat_3 = std::make_shared<material>(metal(vec3(0.7, 0.6, 0.5), 0.0));
 	world.add(std::make_shared<sphere>(vec3(4, 1, 0), 1.0, mat_3));
 
 	return world;
 }
 
+// blue background
+vec3 background_color(const ray& r)
+{
+	vec3 unit_direction = normalize(r.direction());
+	auto t = 0.5 * (unit_direction.y() + 1.0);
+	return (1.0 - t) * vec3(1.0, 1.0, 1.0) + t * vec3(0.5, 0.7, 1.0);
+}
+
 // ray tracing for the objects in the world
 vec3 ray_color(const ray& r, const hittable& world, int depth)
 {
@@ -95,180 +117,748 @@ vec3 ray_color(const ray& r, const hittable& world, int depth)
 		return vec3(0, 0, 0); // hit the back of object
 	}
 
-	// blue background
-	vec3 unit_direction = normalize(r.direction());
-	auto t = 0.5 * (unit_direction.y() + 1.0);
-	return (1.0 - t) * vec3(1.0, 1.0, 1.0) + t * vec3(0.5, 0.7, 1.0);
+	return background_color(r);
 }
 
-int main(int argc, char* argv)
+// fill the image coordinates of a PACKET_DIM x PACKET_DIM tile, pixels outside the image are masked off
+void setup_packet(ray_packet& rp, double s[PACKET_SIZE], double t[PACKET_SIZE], int tile_i, int tile_j,
+	int image_width, int image_height, bool jitter)
 {
-    // Image
-	const auto aspect_ratio = 3.0 / 2.0;
-    const int image_width = 1200;
-	const int image_height = static_cast<int>(image_width / aspect_ratio);
-	const int samples_per_pixel = 500;
-	const int max_depth = 50;
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		int i = tile_i + lane % PACKET_DIM;
+		int j = tile_j + lane / PACKET_DIM;
+		rp.active[lane] = i < image_width && j < image_height;
+		s[lane] = (i + (jitter ? random_double() : 0.0)) / (image_width - 1);
+		t[lane] = (j + (jitter ? random_double() : 0.0)) / (image_height - 1);
+	}
+}
 
-	// World
-	auto world = random_scene();
+// trace the coherent primary rays together, the rays diverge after the first bounce so continue one by one
+void packet_color(const ray_packet& rp, const hittable& world, int depth, vec3 colors[PACKET_SIZE])
+{
+	hit_record recs[PACKET_SIZE];
+	double closest_t[PACKET_SIZE];
+	bool is_hit[PACKET_SIZE];
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		closest_t[lane] = BIG_NUMBER;
+		is_hit[lane] = false;
+	}
 
-	// Camera
-	vec3 lookfrom(13, 2, 3);
-	vec3 lookat(0, 0, 0);
-	vec3 vup(0, 1, 0);
-	auto dist_to_focus = 10.0;
-	auto aperture = 0.1;
+	world.hit_packet(rp, 0.001, closest_t, recs, is_hit);
 
-	camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		if (!rp.active[lane]) continue;
 
-	static bool use_antialiasing = true;
+		ray r = rp.get(lane);
+		if (is_hit[lane])
+		{
+			ray scattered_ray;
+			vec3 attenuation;
+			if (depth > 0 && recs[lane].mat->scatter(r, recs[lane], attenuation, scattered_ray))
+				colors[lane] = attenuation * ray_color(scattered_ray, world, depth - 1);
+			else
+				colors[lane] = vec3(0, 0, 0);
+		}
+		else
+		{
+			colors[lane] = background_color(r);
+		}
+	}
+}
+
+// measure primary ray hit throughput of the scalar path against the packet path, single threaded
+void benchmark_primary_rays(const camera& cam, const hittable& world, int image_width, int image_height)
+{
+	// generate the rays once, so both paths trace the same rays and rand() stays out of the timings
+	std::vector<ray_packet> packets;
+	for (int tile_j = 0; tile_j < image_height; tile_j += PACKET_DIM) {
+		for (int tile_i = 0; tile_i < image_width; tile_i += PACKET_DIM) {
+			ray_packet rp;
+			double s[PACKET_SIZE], t[PACKET_SIZE];
+			setup_packet(rp, s, t, tile_i, tile_j, image_width, image_height, false);
+			cam.get_ray_packet(s, t, rp);
+			packets.push_back(rp);
+		}
+	}
+	std::vector<ray> rays;
+	for (const auto& rp : packets)
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+			if (rp.active[lane])
+				rays.push_back(rp.get(lane));
+
+	size_t scalar_hits = 0;
+	auto time_now = std::chrono::steady_clock::now();
+	for (const auto& r : rays)
+	{
+		hit_record rec;
+		if (world.hit(r, 0.001, BIG_NUMBER, rec))
+			scalar_hits++;
+	}
+	double scalar_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_now).count();
 
-    // Render
-	if (argc > 1)
+	size_t packet_hits = 0;
+	time_now = std::chrono::steady_clock::now();
+	for (const auto& rp : packets)
 	{
-		std::ofstream out(argv);
-		if (!out)
+		hit_record recs[PACKET_SIZE];
+		double closest_t[PACKET_SIZE];
+		bool is_hit[PACKET_SIZE];
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
 		{
-			std::cout << "Could not open file " << argv << std::endl;
-			return -1;
+			closest_t[lane] = BIG_NUMBER;
+			is_hit[lane] = false;
 		}
+		world.hit_packet(rp, 0.001, closest_t, recs, is_hit);
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+			packet_hits += is_hit[lane];
+	}
+	double packet_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_now).count();
+
+	double num_rays = double(rays.size());
+	std::cout << "{\"bench\": \"primary_rays\", \"rays\": " << rays.size()
+		<< ", \"scalar_mrays_per_second\": " << num_rays / scalar_time / 1e6
+		<< ", \"packet_mrays_per_second\": " << num_rays / packet_time / 1e6
+		<< ", \"scalar_hits\": " << scalar_hits
+		<< ", \"packet_hits\": " << packet_hits
+		<< "}" << std::endl;
+	if (scalar_hits != packet_hits)
+		std::cerr << "warning: scalar and packet hit counts differ" << std::endl;
+}
 
-		out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+// routes a statically dispatched material through material_base, only used to compare against virtual dispatch
+template<typename T>
+class virtual_material : public material_base
+{
+public:
+	virtual_material(const T& in_mat) : mat(in_mat) {}
 
-		for (int j = image_height - 1; j >= 0; --j) {
-			std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-			for (int i = 0; i < image_width; ++i) {
-				if (use_antialiasing)
-				{
-					vec3 pixel_color(0, 0, 0);
-					for (int s = 0; s < samples_per_pixel; ++s) {
-						auto u = (i + random_double()) / (image_width - 1);
-						auto v = (j + random_double()) / (image_height - 1);
-						ray r = cam.get_ray(u, v);
-						pixel_color += ray_color(r, world, max_depth);
-					}
-					write_color(out, pixel_color, samples_per_pixel);
-				}
-				else
-				{
-					auto u = double(i) / (image_width - 1);
-					auto v = double(j) / (image_height - 1);
-					ray r = cam.get_ray(u, v);
-					vec3 pixel_color = ray_color(r, world, max_depth);
-					write_color(out, pixel_color);
-				}
+	virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const override
+	{
+		return mat.scatter(r_in, rec, attenuation, scattered);
+	}
+
+public:
+	T mat;
+};
+
+// measure the shading cost per bounce of static dispatch against virtual dispatch on the same primary hits
+void benchmark_scatter(const camera& cam, const hittable& world, int image_width, int image_height)
+{
+	std::vector<ray> rays;
+	std::vector<hit_record> recs;
+	for (int j = 0; j < image_height; ++j) {
+		for (int i = 0; i < image_width; ++i) {
+			hit_record rec;
+			ray r = cam.get_ray(double(i) / (image_width - 1), double(j) / (image_height - 1));
+			if (world.hit(r, 0.001, BIG_NUMBER, rec))
+			{
+				rays.push_back(r);
+				recs.push_back(rec);
 			}
 		}
-		std::cerr << "\nDone.\n";
-		return 0;
 	}
-	else
+	if (recs.empty()) return;
+
+	// the same hits, shaded through virtual copies of the materials like before the variant
+	std::unordered_map<const material*, std::shared_ptr<material_base>> virtual_mats;
+	std::vector<const material_base*> virtual_per_hit;
+	for (const auto& rec : recs)
 	{
-		std::ofstream out("./image.ppm");
-		if (!out)
+		auto& virtual_mat = virtual_mats[rec.mat];
+		if (!virtual_mat)
 		{
-			std::cout << "Could not open file!" << std::endl;
-			return -1;
+			virtual_mat = std::visit([](const auto& m) -> std::shared_ptr<material_base> {
+				using T = std::decay_t<decltype(m)>;
+				return std::make_shared<virtual_material<T>>(m);
+				}, rec.mat->mat);
 		}
+		virtual_per_hit.push_back(virtual_mat.get());
+	}
 
-		out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+	const int rounds = 10;
+	auto time_shading = [&](const auto& shade) {
+		size_t scattered_count = 0;
+		auto time_now = std::chrono::steady_clock::now();
+		for (int round = 0; round < rounds; ++round)
+		{
+			for (size_t k = 0; k < recs.size(); ++k)
+			{
+				ray scattered_ray;
+				vec3 attenuation;
+				if (shade(k, attenuation, scattered_ray))
+					scattered_count++;
+			}
+		}
+		double time_cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_now).count();
+		return std::make_pair(time_cost * 1e9 / (double(rounds) * recs.size()), scattered_count);
+	};
+
+	auto static_result = time_shading([&](size_t k, vec3& attenuation, ray& scattered_ray) {
+		return recs[k].mat->scatter(rays[k], recs[k], attenuation, scattered_ray);
+		});
+	auto virtual_result = time_shading([&](size_t k, vec3& attenuation, ray& scattered_ray) {
+		return virtual_per_hit[k]->scatter(rays[k], recs[k], attenuation, scattered_ray);
+		});
+	std::cout << "{\"bench\": \"scatter\", \"bounces\": " << rounds * recs.size()
+		<< ", \"static_ns_per_bounce\": " << static_result.first
+		<< ", \"virtual_ns_per_bounce\": " << virtual_result.first
+		<< ", \"static_scattered\": " << static_result.second
+		<< ", \"virtual_scattered\": " << virtual_result.second
+		<< "}" << std::endl;
+}
 
-		int parallel_method = 1;
+// the pixel offset inside a pixel for one sample
+inline double sample_offset(bool use_antialiasing)
+{
+	return use_antialiasing ? random_double() : 0.0;
+}
 
-		// parallel do ray tracing
-		if (parallel_method == 1)
-		{
-			/////////////////////////////////////////////
-			std::vector<vec3> pixel_colors(image_width * image_height, vec3(0, 0, 0));
-			std::atomic<size_t> atomic_progress_counter;
-			auto time_now = std::chrono::steady_clock::now();
+// pixel_colors holds the summed samples, top row first
+void render_serial(const render_config& config, const camera& cam, const hittable& world, int image_height,
+	std::vector<vec3>& pixel_colors)
+{
+	const int image_width = config.image_width;
+	for (int j = image_height - 1; j >= 0; --j) {
+		std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
+		for (int i = 0; i < image_width; ++i) {
+			vec3 pixel_color(0, 0, 0);
+			for (int s = 0; s < config.samples_per_pixel; ++s)
+			{
+				auto u = (i + sample_offset(config.use_antialiasing())) / (image_width - 1);
+				auto v = (j + sample_offset(config.use_antialiasing())) / (image_height - 1);
+				ray r = cam.get_ray(u, v);
+				pixel_color += ray_color(r, world, config.max_depth);
+			}
+			pixel_colors[(image_height - 1 - j) * image_width + i] = pixel_color;
+		}
+	}
+}
+
+void render_pipeline(const render_config& config, const camera& cam, const hittable& world, int image_height,
+	std::vector<vec3>& pixel_colors)
+{
+	const int image_width = config.image_width;
+	std::atomic<size_t> atomic_progress_counter{ 0 };
+
+	tbb::parallel_for(size_t(0), size_t(image_height), [&](size_t inv_j) {
+		int j = image_height - 1 - inv_j;
+		atomic_progress_counter++;
+		std::cerr << "\rScanlines remaining: " << image_height - atomic_progress_counter << "      " << std::flush;
+
+		tbb::parallel_for(size_t(0), size_t(image_width), [&](size_t i) {
+			vec3 pixel_color(0, 0, 0);
+			int do_sample_step = 0;
+
+			tbb::parallel_pipeline(14,
+				tbb::make_filter<void, void>(
+					tbb::detail::d1::filter_mode::serial_in_order,
+					[&](tbb::flow_control& fc) {
+						if (do_sample_step < config.samples_per_pixel)
+						{
+							do_sample_step++;
+						}
+						else {
+							fc.stop();
+						}
+					}) &
+				tbb::make_filter<void, vec3>(
+					tbb::detail::d1::filter_mode::parallel,
+					[&](tbb::flow_control& fc)-> vec3 {
+						auto u = (i + sample_offset(config.use_antialiasing())) / (image_width - 1);
+						auto v = (j + sample_offset(config.use_antialiasing())) / (image_height - 1);
+						ray r = cam.get_ray(u, v);
+						return ray_color(r, world, config.max_depth);
+					}) &
+				tbb::make_filter<vec3, void>(
+					tbb::detail::d1::filter_mode::serial_out_of_order,
+					[&](vec3 x) {
+						pixel_color += x;
+					})
+				);
+			pixel_colors[inv_j * image_width + i] = pixel_color;
+			});
+		});
+}
+
+inline int packet_tile_size(const render_config& config)
+{
+	return (config.tile_size + PACKET_DIM - 1) / PACKET_DIM * PACKET_DIM;
+}
+
+/** render one tile of PACKET_DIM x PACKET_DIM packets.
+*	rows holds image rows starting at first_row (top row first), so a numa node can write into its own band
+*/
+void render_packet_tile(const render_config& config, const camera& cam, const hittable& world, int image_height,
+	int tile_x, int tile_y, vec3* rows, int first_row)
+{
+	const int image_width = config.image_width;
+	const int tile_size = packet_tile_size(config);
+
+	for (int packet_j = tile_y; packet_j < std::min(tile_y + tile_size, image_height); packet_j += PACKET_DIM) {
+		for (int packet_i = tile_x; packet_i < std::min(tile_x + tile_size, image_width); packet_i += PACKET_DIM) {
+			vec3 packet_colors[PACKET_SIZE];
+			vec3 colors[PACKET_SIZE];
+			ray_packet rp;
+			double s[PACKET_SIZE], t[PACKET_SIZE];
+
+			for (int sample = 0; sample < config.samples_per_pixel; ++sample)
+			{
+				setup_packet(rp, s, t, packet_i, packet_j, image_width, image_height, config.use_antialiasing());
+				cam.get_ray_packet(s, t, rp);
+				packet_color(rp, world, config.max_depth, colors);
+				for (int lane = 0; lane < PACKET_SIZE; ++lane)
+					packet_colors[lane] += colors[lane];
+			}
+
+			for (int lane = 0; lane < PACKET_SIZE; ++lane)
+			{
+				if (!rp.active[lane]) continue;
+				int i = packet_i + lane % PACKET_DIM;
+				int j = packet_j + lane / PACKET_DIM;
+				rows[(image_height - 1 - j - first_row) * image_width + i] = packet_colors[lane];
+			}
+		}
+	}
+}
+
+// packet tracing: every task renders a tile of tile_size pixels
+void render_packet(const render_config& config, const camera& cam, const hittable& world, int image_height,
+	std::vector<vec3>& pixel_colors)
+{
+	const int tile_size = packet_tile_size(config);
+	int tiles_x = (config.image_width + tile_size - 1) / tile_size;
+	int tiles_y = (image_height + tile_size - 1) / tile_size;
+
+	tbb::parallel_for(size_t(0), size_t(tiles_x * tiles_y), [&](size_t tile) {
+		render_packet_tile(config, cam, world, image_height,
+			int(tile % tiles_x) * tile_size, int(tile / tiles_x) * tile_size, pixel_colors.data(), 0);
+		});
+}
 
-			std::cout << "image height: " << image_height << ", image_width: " << image_width << std::endl;
-
-			tbb::parallel_for(size_t(0), size_t(image_height), [&](size_t inv_j) {
-				int j = image_height - 1 - inv_j;
-				atomic_progress_counter++;
-				std::cerr << "\rScanlines remaining: " << image_height - 1 - atomic_progress_counter << "      " << std::flush;
-
-				tbb::parallel_for(size_t(0), size_t(image_width), [&](size_t i) {
-					vec3 pixel_color(0, 0, 0);
-					int do_sample_step = 0;
-
-					tbb::parallel_pipeline(14,
-						tbb::make_filter<void, void>(
-							tbb::detail::d1::filter_mode::serial_in_order,
-							[&](tbb::flow_control& fc) {
-								if (do_sample_step < samples_per_pixel)
-								{
-									do_sample_step++;
-								}
-								else {
-									fc.stop();
-								}
-							}) &
-						tbb::make_filter<void, vec3>(
-							tbb::detail::d1::filter_mode::parallel,
-							[&](tbb::flow_control& fc)-> vec3 {
-								auto u = (i + random_double()) / (image_width - 1);
-							auto v = (j + random_double()) / (image_height - 1);
-							ray r = cam.get_ray(u, v);
-							return ray_color(r, world, max_depth);
-							}
-							) &
-								tbb::make_filter<vec3, void>(
-									tbb::detail::d1::filter_mode::serial_out_of_order,
-									[&](vec3 x) {
-										pixel_color += x;
-									})
-								);
-					pixel_colors[inv_j * image_width + i] = pixel_color;
+// the numa nodes the arenas are bound to, extra simulated nodes get no binding
+std::vector<tbb::numa_node_id> numa_node_ids(const render_config& config)
+{
+#ifdef NRT_TBBMALLOC_PROXY
+	// tbbbind aborts on the topology query when tbbmalloc_proxy replaces malloc, so every arena stays unbound
+	std::vector<tbb::numa_node_id> detected;
+#else
+	std::vector<tbb::numa_node_id> detected = tbb::info::numa_nodes();
+#endif
+	int num_nodes = config.numa_nodes > 0 ? config.numa_nodes : std::max(1, int(detected.size()));
+
+	std::vector<tbb::numa_node_id> node_ids(num_nodes, tbb::numa_node_id(tbb::task_arena::automatic));
+	for (int node = 0; node < num_nodes && node < int(detected.size()); ++node)
+		node_ids[node] = detected[node];
+	return node_ids;
+}
+
+/** numa aware packet tracing: every node gets a pinned task_arena, its own replica of the scene and
+*	a contiguous band of tile rows. the band of the framebuffer is allocated inside the arena,
+*	so the first touch places it in the node's memory
+*/
+void render_packet_numa(const render_config& config, const camera& cam, const hittable& world, int image_height,
+	std::vector<vec3>& pixel_colors)
+{
+	const int image_width = config.image_width;
+	const int tile_size = packet_tile_size(config);
+	int tiles_x = (image_width + tile_size - 1) / tile_size;
+	int tiles_y = (image_height + tile_size - 1) / tile_size;
+
+	std::vector<tbb::numa_node_id> node_ids = numa_node_ids(config);
+	const int num_nodes = int(node_ids.size());
+	int total_threads = int(tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism));
+
+	std::vector<tbb::task_arena> arenas(num_nodes);
+	std::vector<tbb::task_group> task_groups(num_nodes);
+	std::vector<std::shared_ptr<hittable>> replicas(num_nodes);
+	std::vector<std::vector<vec3>> bands(num_nodes);
+	std::vector<int> band_first_row(num_nodes);
+
+	for (int node = 0; node < num_nodes; ++node)
+	{
+		// the leftover threads of an uneven split go to the first nodes. no slot is reserved for the
+		// main thread, it only submits the bands and waits
+		int node_threads = std::max(1, total_threads / num_nodes + (node < total_threads % num_nodes ? 1 : 0));
+		arenas[node].initialize(tbb::task_arena::constraints(node_ids[node], node_threads), 0);
+
+		// tile rows [tile_row_begin, tile_row_end) go to this node, counted from the bottom of the image
+		int tile_row_begin = tiles_y * node / num_nodes;
+		int tile_row_end = tiles_y * (node + 1) / num_nodes;
+		int j_begin = tile_row_begin * tile_size;
+		int j_end = std::min(tile_row_end * tile_size, image_height);
+		band_first_row[node] = image_height - j_end;
+
+		arenas[node].execute([&, node, tile_row_begin, tile_row_end, j_begin, j_end] {
+			task_groups[node].run([&, node, tile_row_begin, tile_row_end, j_begin, j_end] {
+				replicas[node] = world.clone();
+				bands[node].resize(size_t(std::max(0, j_end - j_begin)) * image_width);
+				camera node_cam = cam;
+
+				tbb::parallel_for(size_t(tile_row_begin * tiles_x), size_t(tile_row_end * tiles_x), [&](size_t tile) {
+					render_packet_tile(config, node_cam, *replicas[node], image_height,
+						int(tile % tiles_x) * tile_size, int(tile / tiles_x) * tile_size,
+						bands[node].data(), band_first_row[node]);
 					});
 				});
+			});
+	}
+
+	for (int node = 0; node < num_nodes; ++node)
+		arenas[node].execute([&, node] { task_groups[node].wait(); });
+
+	for (int node = 0; node < num_nodes; ++node)
+		std::copy(bands[node].begin(), bands[node].end(), pixel_colors.begin() + size_t(band_first_row[node]) * image_width);
+}
+
+// thread scaling of the packet integrator with numa awareness off and on, one json line per run
+void benchmark_numa(const render_config& config, const camera& cam, const hittable& world, int image_height)
+{
+	int max_threads = int(tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism));
+	std::vector<int> thread_counts;
+	for (int threads = 1; threads < max_threads; threads *= 2)
+		thread_counts.push_back(threads);
+	thread_counts.push_back(max_threads);
+
+	for (bool numa : { false, true })
+	{
+		double single_thread_time = 0;
+		for (int threads : thread_counts)
+		{
+			tbb::global_control thread_limit(tbb::global_control::max_allowed_parallelism, threads);
+			render_config run_config = config;
+			run_config.numa = numa;
+			std::vector<vec3> pixel_colors(config.image_width * image_height, vec3(0, 0, 0));
+
+			auto time_now = std::chrono::steady_clock::now();
+			if (numa)
+				render_packet_numa(run_config, cam, world, image_height, pixel_colors);
+			else
+				render_packet(run_config, cam, world, image_height, pixel_colors);
 			double time_cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_now).count();
-			std::cout << std::endl << "time cost: " << int(time_cost) / 60 << "m, " << int(time_cost) % 60 << "s" << std::endl;
-			for (auto& pixel_color : pixel_colors)
+
+			if (threads == 1)
+				single_thread_time = time_cost;
+			std::cout << "{\"bench\": \"numa\", \"numa\": " << (numa ? "true" : "false")
+				<< ", \"numa_nodes\": " << (numa ? numa_node_ids(config).size() : 1)
+				<< ", \"threads\": " << threads
+				<< ", \"seconds\": " << time_cost
+				<< ", \"efficiency\": " << single_thread_time / (threads * time_cost)
+				<< "}" << std::endl;
+		}
+	}
+}
+
+// pixel_colors: summed samples, top row first
+void write_image(std::ofstream& out, const std::string& format, int image_width, int image_height,
+	const std::vector<vec3>& pixel_colors, int samples_per_pixel)
+{
+	if (format == "pfm")
+	{
+		// pfm rows go from bottom to top
+		out << "PF\n" << image_width << ' ' << image_height << "\n-1.0\n";
+		for (int row = image_height - 1; row >= 0; --row)
+			for (int i = 0; i < image_width; ++i)
+				write_color_pfm(out, pixel_colors[row * image_width + i], samples_per_pixel);
+	}
+	else
+	{
+		out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+		for (auto& pixel_color : pixel_colors)
+		{
+			write_color(out, pixel_color, samples_per_pixel);
+		}
+	}
+}
+
+/** long running preview: the scene stays resident and commands come in on stdin (see preview.h).
+*	every frame adds one sample per pixel with the packet integrator, the accumulation restarts only when
+*	the view changes. the resolution scales so a frame takes about frame_ms, it is picked in the first frames
+*	after an update and then held, so a noisy frame time does not restart the accumulation.
+*	every frame is reported as a json line on stdout. the first one after an update adds latency_ms, from applying
+*	the update to the end of the frame, and queue_ms, the time the update waited before it was applied
+*/
+int run_preview(const render_config& config, const hittable& world, preview_state state, double aspect_ratio)
+{
+	const double min_scale = 0.125;
+	const int scale_frames = 2; // frames after an update that may change the resolution
+	// the reader owns a reference, it can still be blocked on stdin or pushing after run_preview returned
+	auto queue = std::make_shared<command_queue>();
+
+	// stdin is read on its own thread so the render loop never blocks on it
+	std::thread reader([queue] {
+		std::string line;
+		while (std::getline(std::cin, line))
+		{
+			if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+			preview_command cmd;
+			std::string error;
+			cmd.received = std::chrono::steady_clock::now();
+			if (!parse_command(line, cmd, error))
 			{
-				write_color(out, pixel_color, samples_per_pixel);
+				// reported by the render loop, so the output lines stay in order
+				cmd.name = "error";
+				cmd.path = error;
 			}
+			queue->push(cmd);
 		}
-		else if (parallel_method == 2)
+		queue->close();
+		});
+	reader.detach();
+
+	double scale = min_scale;
+	int width = 0, height = 0;
+	std::vector<vec3> accum, frame;
+	int accum_spp = 0;
+	size_t frame_count = 0;
+	int frames_since_update = 0;
+	bool latency_pending = false;
+	auto update_time = std::chrono::steady_clock::now(); // when the update was applied
+	double update_queue_ms = 0; // how long it waited in the queue, e.g. behind a wait
+	std::deque<preview_command> pending;
+	bool open = true;
+
+	while (true)
+	{
+		// when converged there is nothing to render, so wait for the next command
+		bool converged = accum_spp >= state.target_spp;
+		if (open)
+			open = queue->drain(pending, converged && pending.empty());
+		// stdin is closed and every command is done
+		if (!open && pending.empty()) break;
+
+		bool changed = false;
+		bool quit = false;
+		while (!pending.empty())
 		{
-			auto time_now = std::chrono::steady_clock::now();
-			for (int j = image_height - 1; j >= 0; --j) {
-				std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-				for (int i = 0; i < image_width; ++i) {
-					if (use_antialiasing)
-					{
-						vec3 pixel_color(0, 0, 0);
-						for (int s = 0; s < samples_per_pixel; ++s)
-						{
-							auto u = (i + random_double()) / (image_width - 1);
-							auto v = (j + random_double()) / (image_height - 1);
-							ray r = cam.get_ray(u, v);
-							pixel_color += ray_color(r, world, max_depth);
-						}
-						write_color(out, pixel_color, samples_per_pixel);
-					}
-					else
-					{
-						auto u = double(i) / (image_width - 1);
-						auto v = double(j) / (image_height - 1);
-						ray r = cam.get_ray(u, v);
-						vec3 pixel_color = ray_color(r, world, max_depth);
-						write_color(out, pixel_color);
-					}
+			const preview_command& cmd = pending.front();
+			bool cmd_changed = false;
+			if (apply_command(state, cmd, cmd_changed))
+			{
+				if (cmd_changed && !changed && !latency_pending)
+				{
+					update_time = std::chrono::steady_clock::now();
+					update_queue_ms = std::chrono::duration<double, std::milli>(update_time - cmd.received).count();
 				}
+				changed |= cmd_changed;
+				// a new target frame time picks the resolution again
+				if (cmd.name == "frame-ms")
+					frames_since_update = 0;
 			}
-			double time_cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_now).count();
-			std::cout << std::endl << "time cost: " << int(time_cost) / 60 << "m, " << int(time_cost) % 60 << "s" << std::endl;
+			else if (cmd.name == "save")
+			{
+				// save and wait refer to the image after the updates before them
+				if (changed || accum_spp == 0) break;
+				std::ofstream out(cmd.path, std::ios::binary);
+				if (out)
+				{
+					write_image(out, "ppm", width, height, accum, accum_spp);
+					std::cout << "{\"event\": \"saved\", \"path\": \"" << json_escape(cmd.path) << "\", \"spp\": " << accum_spp << "}" << std::endl;
+				}
+				else
+					std::cout << "{\"event\": \"error\", \"message\": \"could not open " << json_escape(cmd.path) << "\"}" << std::endl;
+			}
+			else if (cmd.name == "wait")
+			{
+				if (changed || accum_spp < std::min(int(cmd.args[0]), state.target_spp)) break;
+			}
+			else if (cmd.name == "status")
+			{
+				std::cout << "{\"event\": \"status\", \"width\": " << width << ", \"height\": " << height
+					<< ", \"spp\": " << accum_spp << ", \"target_spp\": " << state.target_spp
+					<< ", \"frame_ms\": " << state.frame_ms << "}" << std::endl;
+			}
+			else if (cmd.name == "error")
+			{
+				std::cout << "{\"event\": \"error\", \"message\": \"" << json_escape(cmd.path) << "\"}" << std::endl;
+			}
+			else if (cmd.name == "quit")
+			{
+				quit = true;
+				break;
+			}
+			pending.pop_front();
+		}
+		if (quit) break;
+
+		if (changed)
+		{
+			accum_spp = 0;
+			frames_since_update = 0;
+			latency_pending = true;
 		}
 
+		if (accum_spp >= state.target_spp)
+			continue;
 
-		out.close();
-		std::cerr << "\nDone.\n";
+		// restart the accumulation when the resolution changes
+		int new_width = std::max(PACKET_DIM, int(config.image_width * scale));
+		int new_height = std::max(2, static_cast<int>(new_width / aspect_ratio));
+		if (new_width != width || new_height != height || accum_spp == 0)
+		{
+			width = new_width;
+			height = new_height;
+			accum.assign(size_t(width) * height, vec3(0, 0, 0));
+			frame.assign(size_t(width) * height, vec3(0, 0, 0));
+			accum_spp = 0;
+		}
+
+		render_config frame_config = config;
+		frame_config.image_width = width;
+		frame_config.samples_per_pixel = 1;
+		frame_config.max_depth = state.max_depth;
+		camera cam(state.lookfrom, state.lookat, state.vup, state.vfov, aspect_ratio, state.aperture, state.focus_dist);
+		cam.set_image_height(height);
+
+		auto frame_start = std::chrono::steady_clock::now();
+		render_packet(frame_config, cam, world, height, frame);
+		for (size_t k = 0; k < accum.size(); ++k)
+			accum[k] += frame[k];
+		accum_spp++;
+		frame_count++;
+		auto frame_end = std::chrono::steady_clock::now();
+		double frame_ms = std::chrono::duration<double, std::milli>(frame_end - frame_start).count();
+
+		std::cout << "{\"event\": \"frame\", \"frame\": " << frame_count
+			<< ", \"width\": " << width << ", \"height\": " << height
+			<< ", \"spp\": " << accum_spp << ", \"frame_ms\": " << frame_ms;
+		if (latency_pending)
+		{
+			std::cout << ", \"latency_ms\": " << std::chrono::duration<double, std::milli>(frame_end - update_time).count()
+				<< ", \"queue_ms\": " << update_queue_ms;
+		}
+		std::cout << "}" << std::endl;
+		latency_pending = false;
+
+		// frame time goes with the pixel count, so the step is sqrt of the ratio. the slack keeps
+		// a close enough resolution, a change restarts the accumulation
+		if (frames_since_update++ < scale_frames
+			&& (frame_ms > 1.25 * state.frame_ms || (frame_ms < 0.75 * state.frame_ms && scale < 1.0)))
+			scale = clamp(scale * std::sqrt(state.frame_ms / std::max(frame_ms, 1e-3)), min_scale, 1.0);
+	}
+
+	std::cout << "{\"event\": \"quit\", \"frames\": " << frame_count << "}" << std::endl;
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	auto start_time = std::chrono::steady_clock::now();
+
+	render_config config;
+	if (!parse_args(argc, argv, config))
+		return -1;
+	if (config.show_help)
+	{
+		print_usage(std::cout);
 		return 0;
 	}
 
-    return 0;
-}
\ No newline at end of file
+	if (config.numa && config.integrator != "packet")
+	{
+		std::cerr << "--numa on needs the packet integrator" << std::endl;
+		return -1;
+	}
+	if (config.numa)
+		config.numa_nodes = int(numa_node_ids(config).size());
+#ifdef NRT_TBBMALLOC_PROXY
+	if (config.numa || config.bench_numa)
+		std::cerr << "numa arenas are not pinned in a build with tbbmalloc_proxy, configure with -DUSE_TBBMALLOC_PROXY=OFF" << std::endl;
+#endif
+
+	std::unique_ptr<tbb::global_control> thread_limit;
+	if (config.threads > 0)
+		thread_limit = std::make_unique<tbb::global_control>(tbb::global_control::max_allowed_parallelism, config.threads);
+	int threads = int(tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism));
+
+	// Image
+	const auto aspect_ratio = 3.0 / 2.0;
+	const int image_width = config.image_width;
+	const int image_height = std::max(2, static_cast<int>(image_width / aspect_ratio));
+
+	// Texture
+	std::shared_ptr<texture_cache> tex_cache;
+	std::shared_ptr<texture> sphere_texture;
+	if (!config.texture.empty())
+	{
+		const std::string& path = config.texture;
+		bool is_tiled = path.size() >= 4 && path.substr(path.size() - 4) == ".rtt";
+		auto image = is_tiled ? tiled_image::open(path) : tiled_image::from_ppm(path, config.texture_tile);
+		if (!image)
+		{
+			std::cerr << "Could not " << (is_tiled ? "open" : "convert") << " texture " << path << std::endl;
+			return -1;
+		}
+		tex_cache = std::make_shared<texture_cache>(size_t(config.texture_cache_mb) << 20);
+		sphere_texture = std::make_shared<image_texture>(image, tex_cache);
+	}
+
+	// World
+	auto world = random_scene(sphere_texture);
+
+	// Camera
+	preview_state view;
+	view.aperture = config.aperture;
+	view.max_depth = config.max_depth;
+	view.target_spp = config.samples_per_pixel;
+	view.frame_ms = config.frame_ms;
+
+	if (config.preview)
+		return run_preview(config, world, view, aspect_ratio);
+
+	camera cam(view.lookfrom, view.lookat, view.vup, view.vfov, aspect_ratio, view.aperture, view.focus_dist);
+	cam.set_image_height(image_height);
+
+	if (config.bench_primary_rays)
+		benchmark_primary_rays(cam, world, image_width, image_height);
+	if (config.bench_scatter)
+		benchmark_scatter(cam, world, image_width, image_height);
+	if (config.bench_numa)
+		benchmark_numa(config, cam, world, image_height);
+
+	std::ofstream out(config.output, std::ios::binary);
+	if (!out)
+	{
+		std::cerr << "Could not open file " << config.output << std::endl;
+		return -1;
+	}
+
+	// Render
+	std::cerr << "image height: " << image_height << ", image_width: " << image_width << std::endl;
+	std::vector<vec3> pixel_colors(image_width * image_height, vec3(0, 0, 0));
+	auto time_now = std::chrono::steady_clock::now();
+
+	if (config.integrator == "serial")
+		render_serial(config, cam, world, image_height, pixel_colors);
+	else if (config.integrator == "packet" && config.numa)
+		render_packet_numa(config, cam, world, image_height, pixel_colors);
+	else if (config.integrator == "packet")
+		render_packet(config, cam, world, image_height, pixel_colors);
+	else
+		render_pipeline(config, cam, world, image_height, pixel_colors);
+
+	double time_cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_now).count();
+	std::cerr << std::endl << "time cost: " << int(time_cost) / 60 << "m, " << int(time_cost) % 60 << "s" << std::endl;
+
+	write_image(out, config.format, image_width, image_height, pixel_colors, config.samples_per_pixel);
+	out.close();
+
+	double total_cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	if (tex_cache)
+	{
+		auto stats = tex_cache->get_stats();
+		std::cout << "{\"texture_cache\": {\"hits\": " << stats.hits
+			<< ", \"misses\": " << stats.misses
+			<< ", \"hit_rate\": " << stats.hit_rate()
+			<< ", \"evictions\": " << stats.evictions
+			<< ", \"bytes\": " << stats.bytes
+			<< ", \"peak_bytes\": " << stats.peak_bytes
+			<< ", \"capacity_bytes\": " << tex_cache->capacity_bytes
+			<< "}}" << std::endl;
+	}
+	write_summary(std::cout, config, image_height, threads, time_cost, total_cost);
+	std::cerr << "Done.\n";
+	return 0;
+}
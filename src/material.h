@@ -1,59 +1,72 @@
 #pragma once
 #include "defines.h"
+#include "texture.h"
+
+#include <variant>
 
 struct hit_record;
 
-class material
+// diffuse bounces scatter over the hemisphere, so their ray cone opens wide and the textures they hit read coarse mips
+const double DIFFUSE_CONE_ANGLE = 0.5;
+
+/** base class for materials that are not part of the closed set below,
+*	they are called through a virtual function and are slower to shade
+*/
+class material_base
 {
 public:
 	virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const = 0;
 };
 
-class lambertian : public material
+class lambertian
 {
 public:
 	lambertian(const vec3& a) : albedo(a) {}
+	lambertian(std::shared_ptr<texture> t) : albedo(1.0, 1.0, 1.0), tex(t) {}
 
-	virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const override
+	inline bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
 	{
 		auto scatter_dir = rec.normal + random_unit_vector();
 		// check if direction is zero
 		if (scatter_dir.near_zero())
 			scatter_dir = rec.normal;
-		scattered = ray(rec.p, scatter_dir);
-		attenuation = albedo;
+		scattered = ray(rec.p, scatter_dir, rec.cone_width, DIFFUSE_CONE_ANGLE);
+		attenuation = tex ? tex->value(rec.u, rec.v, rec.p, rec.uv_footprint) : albedo;
 		return true;
 	}
 
 public:
-	vec3 albedo;
+	vec3 albedo; // constant color, kept inline so untextured scatter needs no virtual call
+	std::shared_ptr<texture> tex; // optional, replaces albedo
 };
 
-class metal : public material
+class metal
 {
 public:
 	metal(const vec3& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
-	virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered)
-		const override
+	metal(std::shared_ptr<texture> t, double f) : albedo(1.0, 1.0, 1.0), tex(t), fuzz(f < 1 ? f : 1) {}
+
+	inline bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
 	{
 		vec3 reflect_dir = reflect(normalize(r_in.direction()), rec.normal);
-		scattered = ray(rec.p, reflect_dir + fuzz * random_in_unit_sphere());
-		attenuation = albedo;
+		// the fuzz widens the reflected cone
+		scattered = ray(rec.p, reflect_dir + fuzz * random_in_unit_sphere(), rec.cone_width, r_in.cone_angle + fuzz);
+		attenuation = tex ? tex->value(rec.u, rec.v, rec.p, rec.uv_footprint) : albedo;
 		return (dot(scattered.direction(), rec.normal) > 0);
 	}
 
 public:
 	vec3 albedo; // rays that attenuate
+	std::shared_ptr<texture> tex; // optional, replaces albedo
 	double fuzz; // fuzzy reflection
 };
 
-class dielectric : public material
+class dielectric
 {
 public:
 	dielectric(double in_ir) : ir(in_ir) {}
 
-	virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered)
-		const override
+	inline bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
 	{
 		attenuation = vec3(1.0, 1.0, 1.0);
 		double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
@@ -70,7 +83,7 @@ public:
 		else
 			direction = refract(ray_dir, rec.normal, refraction_ratio);
 
-		scattered = ray(rec.p, direction);
+		scattered = ray(rec.p, direction, rec.cone_width, r_in.cone_angle);
 		return true;
 	}
 
@@ -85,4 +98,38 @@ private:
 		r0 = r0 * r0;
 		return r0 + (1.0 - r0) * std::pow((1 - cosine), 5);
 	}
-};
\ No newline at end of file
+};
+
+// wraps a material_base so it can live in the variant
+class dynamic_material
+{
+public:
+	dynamic_material(std::shared_ptr<material_base> in_mat) : mat(in_mat) {}
+
+	inline bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
+	{
+		return mat->scatter(r_in, rec, attenuation, scattered);
+	}
+
+public:
+	std::shared_ptr<material_base> mat;
+};
+
+/** the material set is closed and dispatched statically, so scatter inlines into ray_color.
+*	to add a material, write a class with the same scatter function and add it to this list
+*/
+using material_variant = std::variant<lambertian, metal, dielectric, dynamic_material>;
+
+class material
+{
+public:
+	material(const material_variant& in_mat) : mat(in_mat) {}
+
+	inline bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
+	{
+		return std::visit([&](const auto& m) { return m.scatter(r_in, rec, attenuation, scattered); }, mat);
+	}
+
+public:
+	material_variant mat;
+};
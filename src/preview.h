@@ -0,0 +1,167 @@
+#pragma once
+#include "defines.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/** one line of the preview protocol, read from stdin:
+*	lookfrom x y z | lookat x y z | vup x y z | vfov deg | aperture a | focus dist | depth n
+*	spp n          accumulate up to n samples per pixel, then idle
+*	frame-ms n     target frame time, the preview resolution scales to meet it
+*	wait n         hold the following commands until n samples are accumulated
+*	save path      write the current preview as ppm, after at least one frame
+*	status | quit
+*/
+struct preview_command {
+public:
+	std::string name;
+	std::vector<double> args;
+	std::string path;
+	std::chrono::steady_clock::time_point received;
+};
+
+// camera and render parameters that can change while the preview runs
+struct preview_state {
+public:
+	vec3 lookfrom = vec3(13, 2, 3);
+	vec3 lookat = vec3(0, 0, 0);
+	vec3 vup = vec3(0, 1, 0);
+	double vfov = 20;
+	double aperture = 0.1;
+	double focus_dist = 10.0;
+	int max_depth = 50;
+	int target_spp = 500;
+	double frame_ms = 100;
+};
+
+inline bool parse_command(const std::string& line, preview_command& cmd, std::string& error)
+{
+	std::istringstream in(line);
+	if (!(in >> cmd.name))
+	{
+		error = "empty command";
+		return false;
+	}
+
+	int num_args = 0;
+	if (cmd.name == "lookfrom" || cmd.name == "lookat" || cmd.name == "vup") num_args = 3;
+	else if (cmd.name == "vfov" || cmd.name == "aperture" || cmd.name == "focus" || cmd.name == "depth"
+		|| cmd.name == "spp" || cmd.name == "frame-ms" || cmd.name == "wait") num_args = 1;
+	else if (cmd.name == "save")
+	{
+		if (!(in >> cmd.path))
+		{
+			error = "save needs a path";
+			return false;
+		}
+		return true;
+	}
+	else if (cmd.name != "status" && cmd.name != "quit")
+	{
+		error = "unknown command " + cmd.name;
+		return false;
+	}
+
+	cmd.args.resize(num_args);
+	for (auto& arg : cmd.args)
+	{
+		if (!(in >> arg))
+		{
+			error = cmd.name + " needs " + std::to_string(num_args) + " numbers";
+			return false;
+		}
+	}
+	return true;
+}
+
+// escape a string for the json lines on stdout, paths and error messages come from the user
+inline std::string json_escape(const std::string& text)
+{
+	std::string out;
+	for (char c : text)
+	{
+		if (c == '"') out += "\\\"";
+		else if (c == '\\') out += "\\\\";
+		else if (c == '\n') out += "\\n";
+		else if (c == '\r') out += "\\r";
+		else if (c == '\t') out += "\\t";
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char code[8];
+			std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(c));
+			out += code;
+		}
+		else out += c;
+	}
+	return out;
+}
+
+/** apply a parameter command to the state. changed is set when the image changes,
+*	which restarts the accumulation. returns false for commands that are not parameters
+*/
+inline bool apply_command(preview_state& state, const preview_command& cmd, bool& changed)
+{
+	const auto& a = cmd.args;
+	if (cmd.name == "lookfrom") { state.lookfrom = vec3(a[0], a[1], a[2]); changed = true; }
+	else if (cmd.name == "lookat") { state.lookat = vec3(a[0], a[1], a[2]); changed = true; }
+	else if (cmd.name == "vup") { state.vup = vec3(a[0], a[1], a[2]); changed = true; }
+	else if (cmd.name == "vfov") { state.vfov = clamp(a[0], 1.0, 179.0); changed = true; }
+	else if (cmd.name == "aperture") { state.aperture = std::max(0.0, a[0]); changed = true; }
+	else if (cmd.name == "focus") { state.focus_dist = std::max(1e-3, a[0]); changed = true; }
+	else if (cmd.name == "depth") { state.max_depth = std::max(1, int(a[0])); changed = true; }
+	else if (cmd.name == "spp") state.target_spp = std::max(1, int(a[0]));
+	else if (cmd.name == "frame-ms") state.frame_ms = std::max(1.0, a[0]);
+	else return false;
+	return true;
+}
+
+// commands from the reader thread to the render loop
+class command_queue {
+public:
+	void push(const preview_command& cmd)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			commands.push_back(cmd);
+		}
+		ready.notify_one();
+	}
+
+	// no more commands will come
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			closed = true;
+		}
+		ready.notify_one();
+	}
+
+	// move every queued command to out, if wait is set block until there is one or the queue is closed
+	// returns false once the queue is closed and empty
+	bool drain(std::deque<preview_command>& out, bool wait)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		if (wait)
+			ready.wait(guard, [this] { return !commands.empty() || closed; });
+		bool open = !commands.empty() || !closed;
+		while (!commands.empty())
+		{
+			out.push_back(commands.front());
+			commands.pop_front();
+		}
+		return open;
+	}
+
+private:
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<preview_command> commands;
+	bool closed = false;
+};
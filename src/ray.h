@@ -5,8 +5,8 @@ class ray
 {
 public:
 	ray() {}
-	ray(const vec3& origin, const vec3& direction)
-		: ori(origin), dir(direction)
+	ray(const vec3& origin, const vec3& direction, double in_cone_width = 0.0, double in_cone_angle = 0.0)
+		: ori(origin), dir(direction), cone_width(in_cone_width), cone_angle(in_cone_angle)
 	{}
 
 	vec3 origin() const { return ori; }
@@ -17,7 +17,17 @@ public:
 		return ori + t * dir;
 	}
 
+	// width of the ray cone after traveling to t, used to pick texture mip levels
+	double cone_width_at(double t) const
+	{
+		return cone_width + cone_angle * t * dir.length();
+	}
+
 public:
 	vec3 ori;
 	vec3 dir;
+
+	// the ray cone: width at the origin and spread angle
+	double cone_width = 0.0;
+	double cone_angle = 0.0;
 };
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+#include "ray.h"
+
+// a packet is a PACKET_DIM x PACKET_DIM tile of coherent primary rays
+const int PACKET_DIM = 4;
+const int PACKET_SIZE = PACKET_DIM * PACKET_DIM;
+
+/** rays stored as structure of arrays, so the hit tests can run lane by lane
+*	and the compiler is free to vectorize them
+*/
+struct ray_packet {
+public:
+	double ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+	double dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+	bool active[PACKET_SIZE];
+	double cone_angle = 0.0; // primary rays share the pixel spread angle
+
+	inline void set(int lane, const ray& r)
+	{
+		ox[lane] = r.ori.x(); oy[lane] = r.ori.y(); oz[lane] = r.ori.z();
+		dx[lane] = r.dir.x(); dy[lane] = r.dir.y(); dz[lane] = r.dir.z();
+		active[lane] = true;
+		cone_angle = r.cone_angle;
+	}
+
+	inline ray get(int lane) const
+	{
+		return ray(vec3(ox[lane], oy[lane], oz[lane]), vec3(dx[lane], dy[lane], dz[lane]), 0.0, cone_angle);
+	}
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+/** everything that can be changed without recompiling,
+*	filled from the command line and optionally a config file
+*/
+struct render_config {
+public:
+	int image_width = 1200;
+	int samples_per_pixel = 500;
+	int max_depth = 50;
+	double aperture = 0.1;
+	int threads = 0; // 0: let tbb decide
+	std::string integrator = "pipeline"; // pipeline, serial, packet
+	std::string sampler = "jittered"; // jittered, center
+	int tile_size = 16; // pixels per tile side of the packet integrator
+	std::string format = "ppm"; // ppm, pfm
+	std::string output = "./image.ppm";
+	bool numa = false; // per numa node arenas and scene replicas, packet integrator only
+	int numa_nodes = 0; // 0: all detected nodes, more than detected simulates the extra nodes without pinning
+	std::string texture; // ppm or tiled .rtt image for the textured sphere, empty for none
+	int texture_cache_mb = 64;
+	int texture_tile = 64; // tile size used when a ppm is converted
+	bool preview = false; // interactive preview, commands on stdin
+	double frame_ms = 100; // target frame time of the preview
+	bool bench_primary_rays = false;
+	bool bench_scatter = false;
+	bool bench_numa = false;
+	bool show_help = false;
+
+	inline bool use_antialiasing() const { return sampler == "jittered"; }
+};
+
+inline void print_usage(std::ostream& out)
+{
+	out << "usage: NaiveRayTracing [options]\n"
+		<< "  --width N            image width, the height follows the 3:2 aspect ratio (1200)\n"
+		<< "  --spp N              samples per pixel (500)\n"
+		<< "  --depth N            max ray bounces (50)\n"
+		<< "  --aperture X         camera aperture (0.1)\n"
+		<< "  --threads N          worker threads, 0 for all cores (0)\n"
+		<< "  --integrator NAME    pipeline, serial or packet (pipeline)\n"
+		<< "  --sampler NAME       jittered or center (jittered)\n"
+		<< "  --tile N             tile size of the packet integrator (16)\n"
+		<< "  --format NAME        ppm or pfm (ppm)\n"
+		<< "  --output PATH        output image (./image.ppm)\n"
+		<< "  --numa on|off        render the packet integrator with one pinned arena per numa node (off)\n"
+		<< "  --numa-nodes N       numa nodes to use, 0 for all detected, more simulates nodes (0)\n"
+		<< "  --texture PATH       ppm or tiled .rtt image for the textured sphere, a ppm is converted to PATH.rtt\n"
+		<< "  --texture-cache-mb N memory bound of the texture tile cache (64)\n"
+		<< "  --texture-tile N     tile size when converting a ppm (64)\n"
+		<< "  --preview            keep the scene resident and take camera updates on stdin, see preview.h\n"
+		<< "  --frame-ms X         target frame time of the preview in milliseconds (100)\n"
+		<< "  --config PATH        read options from a file, one 'key = value' per line\n"
+		<< "  --bench-primary      benchmark scalar against packet primary rays\n"
+		<< "  --bench-scatter      benchmark static against virtual material dispatch\n"
+		<< "  --bench-numa         benchmark thread scaling with numa awareness on and off\n"
+		<< "  --help               print this message\n";
+}
+
+inline bool parse_int(const std::string& value, int min_value, int& result)
+{
+	std::istringstream in(value);
+	int x;
+	if (!(in >> x) || !in.eof() || x < min_value) return false;
+	result = x;
+	return true;
+}
+
+inline bool parse_double(const std::string& value, double min_value, double& result)
+{
+	std::istringstream in(value);
+	double x;
+	if (!(in >> x) || !in.eof() || x < min_value) return false;
+	result = x;
+	return true;
+}
+
+inline bool parse_choice(const std::string& value, const std::vector<std::string>& choices, std::string& result)
+{
+	if (std::find(choices.begin(), choices.end(), value) == choices.end()) return false;
+	result = value;
+	return true;
+}
+
+inline bool is_option(const std::string& key)
+{
+	static const std::vector<std::string> options = { "width", "spp", "depth", "aperture", "threads", "integrator",
+		"sampler", "tile", "format", "output", "numa", "numa-nodes", "texture", "texture-cache-mb", "texture-tile", "preview", "frame-ms", "config", "bench-primary", "bench-scatter", "bench-numa", "help" };
+	return std::find(options.begin(), options.end(), key) != options.end();
+}
+
+// options without a value
+inline bool is_flag(const std::string& key)
+{
+	return key == "bench-primary" || key == "bench-scatter" || key == "bench-numa" || key == "preview" || key == "help";
+}
+
+inline bool load_config_file(const std::string& path, render_config& config);
+
+// set one option by its long name, returns false if the key or value is not valid
+inline bool set_option(render_config& config, const std::string& key, const std::string& value)
+{
+	bool ok = false;
+	if (key == "width") ok = parse_int(value, 2, config.image_width);
+	else if (key == "spp") ok = parse_int(value, 1, config.samples_per_pixel);
+	else if (key == "depth") ok = parse_int(value, 1, config.max_depth);
+	else if (key == "aperture") ok = parse_double(value, 0.0, config.aperture);
+	else if (key == "threads") ok = parse_int(value, 0, config.threads);
+	else if (key == "integrator") ok = parse_choice(value, { "pipeline", "serial", "packet" }, config.integrator);
+	else if (key == "sampler") ok = parse_choice(value, { "jittered", "center" }, config.sampler);
+	else if (key == "tile") ok = parse_int(value, 1, config.tile_size);
+	else if (key == "format") ok = parse_choice(value, { "ppm", "pfm" }, config.format);
+	else if (key == "output") { config.output = value; ok = !value.empty(); }
+	else if (key == "numa") { ok = value == "on" || value == "off"; if (ok) config.numa = value == "on"; }
+	else if (key == "numa-nodes") ok = parse_int(value, 0, config.numa_nodes);
+	else if (key == "texture") { config.texture = value; ok = !value.empty(); }
+	else if (key == "texture-cache-mb") ok = parse_int(value, 1, config.texture_cache_mb);
+	else if (key == "texture-tile") ok = parse_int(value, 1, config.texture_tile);
+	else if (key == "preview") { config.preview = true; ok = true; }
+	else if (key == "frame-ms") ok = parse_double(value, 1.0, config.frame_ms);
+	else if (key == "config") ok = load_config_file(value, config);
+	else if (key == "bench-primary") { config.bench_primary_rays = true; ok = true; }
+	else if (key == "bench-scatter") { config.bench_scatter = true; ok = true; }
+	else if (key == "bench-numa") { config.bench_numa = true; ok = true; }
+	else if (key == "help") { config.show_help = true; ok = true; }
+	else
+	{
+		std::cerr << "Unknown option " << key << std::endl;
+		return false;
+	}
+
+	if (!ok)
+		std::cerr << "Invalid value '" << value << "' for option " << key << std::endl;
+	return ok;
+}
+
+inline bool load_config_file(const std::string& path, render_config& config)
+{
+	std::ifstream in(path);
+	if (!in)
+	{
+		std::cerr << "Could not open config file " << path << std::endl;
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(in, line))
+	{
+		// strip comments and blanks, then split at '=' or the first space
+		line = line.substr(0, line.find('#'));
+		std::replace(line.begin(), line.end(), '=', ' ');
+		std::istringstream line_in(line);
+		std::string key, value;
+		if (!(line_in >> key)) continue;
+		line_in >> value;
+
+		// a nested config could include itself and recurse until the stack runs out
+		if (key == "config")
+		{
+			std::cerr << "Option config is not allowed in config file " << path << std::endl;
+			return false;
+		}
+		if (!is_flag(key) && value.empty())
+		{
+			std::cerr << "Missing value for option " << key << " in " << path << std::endl;
+			return false;
+		}
+		if (is_flag(key) && !value.empty())
+		{
+			std::cerr << "Option " << key << " takes no value in " << path << std::endl;
+			return false;
+		}
+		if (!set_option(config, key, value))
+			return false;
+	}
+	return true;
+}
+
+// accepts both "--key value" and "--key=value"
+inline bool parse_args(int argc, char** argv, render_config& config)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg.compare(0, 2, "--") != 0)
+		{
+			std::cerr << "Unexpected argument " << arg << std::endl;
+			print_usage(std::cerr);
+			return false;
+		}
+
+		std::string key = arg.substr(2);
+		std::string value;
+		auto eq = key.find('=');
+		if (eq != std::string::npos)
+		{
+			value = key.substr(eq + 1);
+			key = key.substr(0, eq);
+		}
+		if (!is_option(key))
+		{
+			std::cerr << "Unknown option " << key << std::endl;
+			print_usage(std::cerr);
+			return false;
+		}
+		if (is_flag(key) && eq != std::string::npos)
+		{
+			std::cerr << "Option " << key << " takes no value" << std::endl;
+			print_usage(std::cerr);
+			return false;
+		}
+		if (!is_flag(key) && eq == std::string::npos)
+		{
+			if (i + 1 >= argc)
+			{
+				std::cerr << "Missing value for option " << key << std::endl;
+				return false;
+			}
+			value = argv[++i];
+		}
+
+		if (!set_option(config, key, value))
+		{
+			print_usage(std::cerr);
+			return false;
+		}
+	}
+	return true;
+}
+
+// one line of json with the chosen config and the timings, so benchmark sweeps can be scripted
+inline void write_summary(std::ostream& out, const render_config& config, int image_height, int threads,
+	double render_seconds, double total_seconds)
+{
+	double num_samples = double(config.image_width) * image_height * config.samples_per_pixel;
+	out << "{\"width\": " << config.image_width
+		<< ", \"height\": " << image_height
+		<< ", \"spp\": " << config.samples_per_pixel
+		<< ", \"max_depth\": " << config.max_depth
+		<< ", \"aperture\": " << config.aperture
+		<< ", \"threads\": " << threads
+		<< ", \"integrator\": \"" << config.integrator << "\""
+		<< ", \"sampler\": \"" << config.sampler << "\""
+		<< ", \"tile_size\": " << config.tile_size
+		<< ", \"format\": \"" << config.format << "\""
+		<< ", \"numa\": " << (config.numa ? "true" : "false")
+		<< ", \"numa_nodes\": " << config.numa_nodes
+		<< ", \"render_seconds\": " << render_seconds
+		<< ", \"total_seconds\": " << total_seconds
+		<< ", \"msamples_per_second\": " << num_samples / render_seconds / 1e6
+		<< "}" << std::endl;
+}
@@ -2,6 +2,7 @@
 
 #include "hittable.h"
 #include "vec3.h"
+#include "material.h"
 
 class sphere : public hittable {
 public:
@@ -10,11 +11,33 @@ public:
 		: center(cen), radius(r), mat(in_mat) {}
 
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual void hit_packet(const ray_packet& rp, double t_min, double closest_t[PACKET_SIZE],
+		hit_record recs[PACKET_SIZE], bool is_hit[PACKET_SIZE]) const override;
+
+	// the material is copied as well, so constant colors live on the replica's node.
+	// textures stay shared, image tiles come from the shared texture_cache anyway
+	virtual std::shared_ptr<hittable> clone() const override
+	{
+		return std::make_shared<sphere>(center, radius, std::make_shared<material>(*mat));
+	}
 
 public:
     vec3 center;
     double radius;
 	std::shared_ptr<material> mat;
+
+private:
+	// fill the record of a hit at t, shared by hit and hit_packet
+	void set_hit_record(const ray& r, double t, hit_record& rec) const;
+
+	// p: a point on the unit sphere, u: angle around the y axis from x = -1, v: angle from y = -1 to y = 1, both in [0, 1]
+	static void get_sphere_uv(const vec3& p, double& u, double& v)
+	{
+		auto theta = std::acos(clamp(-p.y(), -1.0, 1.0));
+		auto phi = std::atan2(-p.z(), p.x()) + PI;
+		u = phi / (2 * PI);
+		v = theta / PI;
+	}
 };
 
 bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
@@ -36,10 +59,60 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
 			return false;
 	}
 
-    rec.t = root;
-    rec.p = r.at(rec.t);
-    vec3 outward_normal = (rec.p - center) / radius;
-    rec.set_face_normal(r, outward_normal);
-	rec.mat = mat;
+    set_hit_record(r, root, rec);
     return true;
+}
+
+void sphere::set_hit_record(const ray& r, double t, hit_record& rec) const
+{
+	rec.t = t;
+	rec.p = r.at(rec.t);
+	vec3 outward_normal = (rec.p - center) / radius;
+	rec.set_face_normal(r, outward_normal);
+	get_sphere_uv(outward_normal, rec.u, rec.v);
+	rec.mat = mat.get();
+
+	// u wraps 2 * PI * radius around the sphere
+	rec.cone_width = r.cone_width_at(t);
+	rec.uv_footprint = rec.cone_width / (2 * PI * radius);
+}
+
+void sphere::hit_packet(const ray_packet& rp, double t_min, double closest_t[PACKET_SIZE],
+	hit_record recs[PACKET_SIZE], bool is_hit[PACKET_SIZE]) const
+{
+	// first pass: branch free root finding over all lanes
+	double roots[PACKET_SIZE];
+	bool any_hit = false;
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		double ocx = rp.ox[lane] - center.x();
+		double ocy = rp.oy[lane] - center.y();
+		double ocz = rp.oz[lane] - center.z();
+		double a = rp.dx[lane] * rp.dx[lane] + rp.dy[lane] * rp.dy[lane] + rp.dz[lane] * rp.dz[lane];
+		double half_b = ocx * rp.dx[lane] + ocy * rp.dy[lane] + ocz * rp.dz[lane];
+		double c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+
+		double discriminant = half_b * half_b - a * c;
+		double sqrtd = std::sqrt(discriminant > 0 ? discriminant : 0);
+		double near_root = (-half_b - sqrtd) / a;
+		double far_root = (-half_b + sqrtd) / a;
+		double root = near_root >= t_min ? near_root : far_root;
+
+		bool lane_hit = rp.active[lane] && discriminant >= 0 && root >= t_min && root <= closest_t[lane];
+		roots[lane] = lane_hit ? root : -1.0;
+		any_hit |= lane_hit;
+	}
+
+	// the whole packet missed, skip the record pass
+	if (!any_hit) return;
+
+	// second pass: fill the records of the lanes that hit
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		if (roots[lane] < 0) continue;
+
+		set_hit_record(rp.get(lane), roots[lane], recs[lane]);
+		closest_t[lane] = roots[lane];
+		is_hit[lane] = true;
+	}
 }
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+#include "defines.h"
+#include "texture_cache.h"
+
+class texture {
+public:
+	// footprint: width of the ray cone in uv units, used to pick the mip level
+	virtual vec3 value(double u, double v, const vec3& p, double footprint) const = 0;
+};
+
+class solid_color : public texture {
+public:
+	solid_color(const vec3& c) : color(c) {}
+
+	virtual vec3 value(double u, double v, const vec3& p, double footprint) const override
+	{
+		return color;
+	}
+
+public:
+	vec3 color;
+};
+
+// procedural 3d checker board
+class checker_texture : public texture {
+public:
+	checker_texture(std::shared_ptr<texture> in_even, std::shared_ptr<texture> in_odd, double in_scale)
+		: even(in_even), odd(in_odd), scale(in_scale) {}
+	checker_texture(const vec3& c1, const vec3& c2, double in_scale)
+		: even(std::make_shared<solid_color>(c1)), odd(std::make_shared<solid_color>(c2)), scale(in_scale) {}
+
+	virtual vec3 value(double u, double v, const vec3& p, double footprint) const override
+	{
+		auto sines = std::sin(scale * p.x()) * std::sin(scale * p.y()) * std::sin(scale * p.z());
+		return sines < 0 ? odd->value(u, v, p, footprint) : even->value(u, v, p, footprint);
+	}
+
+public:
+	std::shared_ptr<texture> even;
+	std::shared_ptr<texture> odd;
+	double scale;
+};
+
+/** texture backed by a tiled_image on disk, the tiles go through a shared texture_cache.
+*	the mip level follows the ray cone footprint, so wide cones after diffuse bounces
+*	read a few coarse tiles instead of the whole base level
+*/
+class image_texture : public texture {
+public:
+	image_texture(std::shared_ptr<tiled_image> in_image, std::shared_ptr<texture_cache> in_cache)
+		: image(in_image), cache(in_cache) {}
+
+	virtual vec3 value(double u, double v, const vec3& p, double footprint) const override
+	{
+		// one texel of level l covers 2^l / width in u
+		double texels = footprint * std::max(image->width, image->height);
+		int level = texels > 1.0 ? int(std::log2(texels)) : 0;
+		level = std::min(level, image->levels - 1);
+
+		// nearest texel, v = 0 is the bottom of the image
+		int w = image->level_width(level);
+		int h = image->level_height(level);
+		int x = std::min(int(clamp(u, 0.0, 1.0) * w), w - 1);
+		int y = std::min(int((1.0 - clamp(v, 0.0, 1.0)) * h), h - 1);
+
+		auto tile = cache->get(*image, level, x / image->tile_size, y / image->tile_size);
+		return tile->texel(x % image->tile_size, y % image->tile_size);
+	}
+
+public:
+	std::shared_ptr<tiled_image> image;
+	std::shared_ptr<texture_cache> cache;
+};
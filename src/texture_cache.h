@@ -0,0 +1,364 @@
+#pragma once
+#include "defines.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/** one tile_size x tile_size block of texels of one mip level,
+*	stored as 8 bit rgb with the same gamma 2 as the image output
+*/
+struct texture_tile {
+public:
+	int tile_size;
+	std::vector<unsigned char> texels;
+
+	inline vec3 texel(int x, int y) const
+	{
+		const unsigned char* c = &texels[3 * (y * tile_size + x)];
+		auto r = c[0] / 255.0, g = c[1] / 255.0, b = c[2] / 255.0;
+		return vec3(r * r, g * g, b * b);
+	}
+
+	inline size_t bytes() const { return sizeof(texture_tile) + texels.size(); }
+};
+
+/** a tiled, mip-mapped image on disk. only the header is read on open,
+*	the tiles are read on demand through the texture_cache.
+*	file layout: "RTTX", width, height, tile_size, levels as int32, then the tiles of every level
+*	from the finest one, row by row, each a full tile_size * tile_size * 3 bytes
+*/
+class tiled_image {
+public:
+	static std::shared_ptr<tiled_image> open(const std::string& in_path);
+
+	// convert a P3 or P6 ppm into the tiled format, this step keeps the whole image in memory.
+	// the file is written under a temporary name and renamed once complete
+	static bool build(const std::string& ppm_path, const std::string& tiled_path, int tile_size);
+
+	// open ppm_path + ".rtt", rebuilding it when it is missing, incomplete, older than the ppm or has another tile size
+	static std::shared_ptr<tiled_image> from_ppm(const std::string& ppm_path, int tile_size);
+
+	// every level down to 1x1, the count build writes and open expects
+	static inline int level_count(int width, int height)
+	{
+		int levels = 1;
+		while ((width >> levels) > 0 || (height >> levels) > 0) levels++;
+		return levels;
+	}
+
+	inline int level_width(int level) const { return std::max(1, width >> level); }
+	inline int level_height(int level) const { return std::max(1, height >> level); }
+	inline int tiles_x(int level) const { return (level_width(level) + tile_size - 1) / tile_size; }
+	inline int tiles_y(int level) const { return (level_height(level) + tile_size - 1) / tile_size; }
+
+	std::shared_ptr<texture_tile> load_tile(int level, int tile_x, int tile_y) const;
+
+public:
+	// limits of the cache key, see texture_cache::make_key. with them the tile offsets also fit in size_t
+	static const int max_images = 1 << 16;
+	static const int max_size = 1 << 20; // pixels per side, so there are at most 2^20 tiles per side
+	static const int max_tile_size = 4096;
+
+	std::string path;
+	int id; // unique per opened image, part of the cache key
+	int width, height;
+	int tile_size;
+	int levels;
+
+private:
+	static const int header_bytes = 4 + 4 * sizeof(int32_t);
+	inline size_t tile_bytes() const { return size_t(tile_size) * tile_size * 3; }
+	std::vector<size_t> level_offsets;
+};
+
+inline bool read_ppm(const std::string& path, int& width, int& height, std::vector<vec3>& pixels)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in) return false;
+
+	// read the next header token, skipping comments
+	auto next_token = [&in](std::string& token) {
+		while (in >> token)
+		{
+			if (token[0] != '#') return true;
+			std::string rest;
+			std::getline(in, rest);
+		}
+		return false;
+	};
+
+	// the header fields are parsed by the stream, so a malformed one fails instead of throwing
+	auto next_int = [&next_token](int& value) {
+		std::string token;
+		if (!next_token(token)) return false;
+		std::istringstream token_in(token);
+		return bool(token_in >> value) && token_in.eof();
+	};
+
+	std::string magic;
+	int maxval;
+	if (!next_token(magic) || !next_int(width) || !next_int(height) || !next_int(maxval)) return false;
+	if ((magic != "P3" && magic != "P6") || maxval != 255) return false;
+	if (width <= 0 || height <= 0) return false;
+
+	// pixels are stored linear, the output applies gamma 2
+	pixels.resize(size_t(width) * height);
+	if (magic == "P6")
+		in.get();
+	for (auto& pixel : pixels)
+	{
+		int rgb[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			if (magic == "P6")
+				rgb[k] = in.get();
+			else
+				in >> rgb[k];
+		}
+		if (!in) return false;
+		pixel = vec3(rgb[0] * rgb[0], rgb[1] * rgb[1], rgb[2] * rgb[2]) / (255.0 * 255.0);
+	}
+	return true;
+}
+
+inline bool tiled_image::build(const std::string& ppm_path, const std::string& tiled_path, int tile_size)
+{
+	if (tile_size < 1 || tile_size > max_tile_size)
+		return false;
+
+	int width, height;
+	std::vector<vec3> level;
+	if (!read_ppm(ppm_path, width, height, level) || width > max_size || height > max_size)
+		return false;
+
+	const std::string temp_path = tiled_path + ".tmp";
+	std::ofstream out(temp_path, std::ios::binary);
+	if (!out) return false;
+
+	int levels = level_count(width, height);
+	int32_t header[4] = { width, height, tile_size, levels };
+	out.write("RTTX", 4);
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+	int level_w = width, level_h = height;
+	std::vector<unsigned char> tile(size_t(tile_size) * tile_size * 3);
+	for (int l = 0; l < levels; ++l)
+	{
+		for (int ty = 0; ty < (level_h + tile_size - 1) / tile_size; ++ty) {
+			for (int tx = 0; tx < (level_w + tile_size - 1) / tile_size; ++tx) {
+				std::fill(tile.begin(), tile.end(), 0);
+				for (int y = 0; y < tile_size && ty * tile_size + y < level_h; ++y) {
+					for (int x = 0; x < tile_size && tx * tile_size + x < level_w; ++x) {
+						const vec3& c = level[size_t(ty * tile_size + y) * level_w + tx * tile_size + x];
+						for (int k = 0; k < 3; ++k)
+							tile[3 * (y * tile_size + x) + k] = static_cast<unsigned char>(255.999 * std::sqrt(clamp(c[k], 0.0, 1.0)));
+					}
+				}
+				out.write(reinterpret_cast<const char*>(tile.data()), tile.size());
+			}
+		}
+
+		// box filter down to the next level
+		int next_w = std::max(1, level_w / 2), next_h = std::max(1, level_h / 2);
+		std::vector<vec3> next(size_t(next_w) * next_h);
+		for (int y = 0; y < next_h; ++y) {
+			for (int x = 0; x < next_w; ++x) {
+				int x0 = std::min(2 * x, level_w - 1), x1 = std::min(2 * x + 1, level_w - 1);
+				int y0 = std::min(2 * y, level_h - 1), y1 = std::min(2 * y + 1, level_h - 1);
+				next[size_t(y) * next_w + x] = 0.25 * (level[size_t(y0) * level_w + x0] + level[size_t(y0) * level_w + x1]
+					+ level[size_t(y1) * level_w + x0] + level[size_t(y1) * level_w + x1]);
+			}
+		}
+		level.swap(next);
+		level_w = next_w;
+		level_h = next_h;
+	}
+
+	out.close();
+	std::error_code error;
+	if (out.fail())
+	{
+		std::filesystem::remove(temp_path, error);
+		return false;
+	}
+	std::filesystem::rename(temp_path, tiled_path, error);
+	return !error;
+}
+
+inline std::shared_ptr<tiled_image> tiled_image::from_ppm(const std::string& ppm_path, int tile_size)
+{
+	const std::string tiled_path = ppm_path + ".rtt";
+	std::error_code error;
+	auto ppm_time = std::filesystem::last_write_time(ppm_path, error);
+	bool ppm_exists = !error;
+	auto tiled_time = std::filesystem::last_write_time(tiled_path, error);
+
+	if (!error && (!ppm_exists || tiled_time >= ppm_time))
+	{
+		auto image = open(tiled_path);
+		if (image && image->tile_size == tile_size)
+			return image;
+	}
+
+	if (!build(ppm_path, tiled_path, tile_size))
+		return nullptr;
+	return open(tiled_path);
+}
+
+inline std::shared_ptr<tiled_image> tiled_image::open(const std::string& in_path)
+{
+	std::ifstream in(in_path, std::ios::binary);
+	char magic[4];
+	int32_t header[4];
+	if (!in.read(magic, 4) || std::memcmp(magic, "RTTX", 4) != 0) return nullptr;
+	if (!in.read(reinterpret_cast<char*>(header), sizeof(header))) return nullptr;
+	if (header[0] <= 0 || header[0] > max_size || header[1] <= 0 || header[1] > max_size) return nullptr;
+	if (header[2] <= 0 || header[2] > max_tile_size) return nullptr;
+	if (header[3] != level_count(header[0], header[1])) return nullptr;
+
+	// ids are never reused, past the 16 bits of the key two images would share tiles
+	static std::atomic<int> next_id{ 0 };
+	int id = next_id++;
+	if (id >= max_images) return nullptr;
+
+	auto image = std::make_shared<tiled_image>();
+	image->path = in_path;
+	image->id = id;
+	image->width = header[0];
+	image->height = header[1];
+	image->tile_size = header[2];
+	image->levels = header[3];
+
+	size_t offset = header_bytes;
+	for (int l = 0; l < image->levels; ++l)
+	{
+		image->level_offsets.push_back(offset);
+		offset += size_t(image->tiles_x(l)) * image->tiles_y(l) * image->tile_bytes();
+	}
+
+	// a truncated file would read as black tiles
+	in.seekg(0, std::ios::end);
+	if (!in || size_t(in.tellg()) != offset) return nullptr;
+	return image;
+}
+
+inline std::shared_ptr<texture_tile> tiled_image::load_tile(int level, int tile_x, int tile_y) const
+{
+	auto tile = std::make_shared<texture_tile>();
+	tile->tile_size = tile_size;
+	tile->texels.resize(tile_bytes());
+
+	std::ifstream in(path, std::ios::binary);
+	in.seekg(level_offsets[level] + (size_t(tile_y) * tiles_x(level) + tile_x) * tile_bytes());
+	if (!in.read(reinterpret_cast<char*>(tile->texels.data()), tile->texels.size()))
+		std::fill(tile->texels.begin(), tile->texels.end(), 0); // a truncated file reads as black
+	return tile;
+}
+
+/** bounded, thread safe cache of texture tiles. the keys are split over shards,
+*	each with its own mutex and lru list, so threads rarely wait on each other.
+*	a tile that two threads miss at the same time may be read twice, the first insert wins
+*/
+class texture_cache {
+public:
+	texture_cache(size_t in_capacity_bytes) : capacity_bytes(in_capacity_bytes) {}
+
+	std::shared_ptr<const texture_tile> get(const tiled_image& image, int level, int tile_x, int tile_y);
+
+	struct stats {
+		size_t hits;
+		size_t misses;
+		size_t evictions;
+		size_t bytes;
+		size_t peak_bytes;
+
+		inline double hit_rate() const { return hits + misses > 0 ? double(hits) / (hits + misses) : 0.0; }
+	};
+	stats get_stats() const;
+
+public:
+	size_t capacity_bytes;
+
+private:
+	static const int num_shards = 16;
+
+	struct shard {
+		std::mutex lock;
+		std::list<uint64_t> lru; // most recently used first
+		std::unordered_map<uint64_t, std::pair<std::shared_ptr<const texture_tile>, std::list<uint64_t>::iterator>> tiles;
+		size_t bytes = 0;
+	};
+	shard shards[num_shards];
+
+	std::atomic<size_t> hits{ 0 }, misses{ 0 }, evictions{ 0 };
+	std::atomic<size_t> bytes{ 0 }, peak_bytes{ 0 };
+
+	// image id: 16 bits, level: 8 bits, tile y and x: 20 bits each
+	static inline uint64_t make_key(int image_id, int level, int tile_x, int tile_y)
+	{
+		return (uint64_t(image_id & 0xffff) << 48) | (uint64_t(level & 0xff) << 40)
+			| (uint64_t(tile_y & 0xfffff) << 20) | uint64_t(tile_x & 0xfffff);
+	}
+};
+
+inline std::shared_ptr<const texture_tile> texture_cache::get(const tiled_image& image, int level, int tile_x, int tile_y)
+{
+	uint64_t key = make_key(image.id, level, tile_x, tile_y);
+	shard& s = shards[(key ^ (key >> 20) ^ (key >> 40)) % num_shards];
+
+	{
+		std::lock_guard<std::mutex> guard(s.lock);
+		auto it = s.tiles.find(key);
+		if (it != s.tiles.end())
+		{
+			s.lru.splice(s.lru.begin(), s.lru, it->second.second);
+			hits++;
+			return it->second.first;
+		}
+	}
+
+	// read from disk without holding the shard lock
+	misses++;
+	std::shared_ptr<const texture_tile> tile = image.load_tile(level, tile_x, tile_y);
+
+	std::lock_guard<std::mutex> guard(s.lock);
+	auto it = s.tiles.find(key);
+	if (it != s.tiles.end())
+		return it->second.first;
+
+	s.lru.push_front(key);
+	s.tiles.emplace(key, std::make_pair(tile, s.lru.begin()));
+	s.bytes += tile->bytes();
+	size_t total = bytes += tile->bytes();
+
+	// evict the least recently used tiles of this shard, keeping the one just loaded
+	const size_t shard_capacity = capacity_bytes / num_shards;
+	while (s.bytes > shard_capacity && s.lru.size() > 1)
+	{
+		auto victim = s.tiles.find(s.lru.back());
+		size_t victim_bytes = victim->second.first->bytes();
+		s.bytes -= victim_bytes;
+		total = bytes -= victim_bytes;
+		s.tiles.erase(victim);
+		s.lru.pop_back();
+		evictions++;
+	}
+
+	size_t peak = peak_bytes;
+	while (total > peak && !peak_bytes.compare_exchange_weak(peak, total)) {}
+	return tile;
+}
+
+inline texture_cache::stats texture_cache::get_stats() const
+{
+	return stats{ hits, misses, evictions, bytes, peak_bytes };
+}